@@ -1,4 +1,6 @@
 #include <unistd.h>
+#include <errno.h>
+#include <signal.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <stdarg.h>
@@ -8,16 +10,22 @@
 #include <time.h>
 #include <math.h>
 #include <sys/time.h>
+#include <sys/select.h>
+#include <sys/inotify.h>
 #include <sys/types.h>
+#include <sys/stat.h>
 #include <sys/wait.h>
 #include <sys/sysinfo.h>
 #include <dirent.h>
+#include <fcntl.h>
 
 #include <alsa/asoundlib.h>
 #include <alsa/control.h>
 
 
 #include <X11/Xlib.h>
+#include <X11/extensions/dpms.h>
+#include <X11/extensions/scrnsaver.h>
 
 
 typedef struct {
@@ -26,17 +34,83 @@ typedef struct {
     char color[32];
 } BlockData;
 
+typedef struct {
+    char *name;      // display name, NULL for $DISPLAY
+    Display *dpy;
+    Window root;
+    uint64_t mask;   // blocks shown on this target
+    char *last;      // last status sent to this target
+    int saver_event; // MIT-SCREEN-SAVER event base, -1 if unsupported
+    int saver_on;
+    int dpms;        // DPMS capable
+    int visible;
+    int dirty;       // needs a repaint
+    int lost;        // the connection died, closed by check_targets
+    time_t retry;    // next attempt to open the display while it is closed
+} Target;
+
 typedef struct {
     void (*query)(BlockData*);
     const int interval;
     const time_t align;
     const int delay;
+    const int background;
 } Block;
 
+typedef struct {
+    const char *name;
+    void (*query)(BlockData*);
+} Query;
+
+/* Block compiled from the configuration, followed by its scheduler state */
+typedef struct {
+    void (*query)(BlockData*);
+    int interval;
+    time_t align;
+    int delay;
+    int background;
+    char color[32];      // replaces the color chosen by `query` if not empty
+    int flags;           // 0x01 -> call it now
+    time_t next_update;
+    char *string;        // formatted block, NULL until known
+    BlockData data;      // last result of `query`, no color until it ran
+    char seg_color[32];  // color the segments below were built for
+    char seg_icon[80];   // "^c<bar>^^b<color>^ "
+    char seg_text[80];   // " ^c<color>^^b<bar>^"
+    char seg_plain[80];  // "^c<color>^^b<bar>^ "
+} Entry;
+
+typedef struct {
+    char bar_color[32];
+    char fan_hwmon[32];
+    char cpu_hwmon[32];
+    char battery[32];
+    char cgroup_root[64];
+    char cgroup[128];    // path in cgroup_root, empty for our own cgroup
+    size_t nentries;
+    Entry entries[];
+} Config;
+
 /* function declarations */
 char* smprintf(char *fmt, ...);
-void setstatus(char *str);
+void setstatus(Target *t, char *str);
+char* compose_status(uint64_t mask);
+void format_block(Entry *e);
+char* load_file(char *path);
 char* read_file(char *path);
+char* read_fd(int fd);
+void trace_file(char *content);
+int read_sysinfo(struct sysinfo *s);
+int read_volume(void);
+time_t get_now(void);
+int64_t get_usec(void);
+
+int trace_open(char *path, int mode);
+void trace_close(void);
+void trace_write(int type, const void *buf, uint32_t len);
+void* trace_read(int type, uint32_t *len);
+void trace_write_ints(int type, const int64_t *values, int count, int width);
+void trace_read_ints(int type, int64_t *values, int count, int width);
 
 void get_time(BlockData* data);
 void get_battery(BlockData* data);
@@ -45,19 +119,82 @@ void get_temperature(BlockData* data);
 void get_fan_speed(BlockData* data);
 void get_volume(BlockData* data);
 void get_ram(BlockData* data);
+void get_cgroup(BlockData* data);
+char* format_size(unsigned long long bytes);
 
 void sleep_until(time_t seconds);
 int all_space(char *str);
 char* strip(char* str);
 char* find_in_dir(char* path, char* hwmon_name, char* file);
 char* find_sensor(char* path, char* hwmon_name, char* file);
-void detect_sensors(void);
-void free_sensors(void);
+void detect_sensors(int groups);
+void free_sensors(int groups);
+int open_cgroup_file(char *dir, char *file);
+void open_cgroup(void);
+void close_cgroup(void);
+
+char* cache_path(void);
+int load_cache(Config *c);
+void save_cache(Config *c);
+
+char* config_path(void);
+Config* new_config(size_t n);
+Config* default_config(void);
+Config* parse_config(char *text, char *name);
+Config* read_config(void);
+void free_config(Config *c);
+void schedule(Entry *e, time_t now);
+void apply_config(Config *c, time_t now);
+int has_query(Config *c, void (*query)(BlockData*));
+const char* query_name(void (*query)(BlockData*));
+int add_watch(char *path, uint32_t mask);
+char* parent_dir(char *path);
+void watch_config(void);
+int read_watches(void);
+void apply_watches(int watches, time_t now);
+
+void terminate(int signo);
+void usage(void);
+uint64_t parse_blocks(char *list);
+int xioerror(Display *dpy);
+void xioexit(Display *dpy, void *target);
+int open_target(Target *t);
+void trace_targets(void);
+int open_targets(void);
+int check_targets(void);
+void close_targets(void);
+uint32_t read_visibility(void);
+int update_visibility(void);
 
 #define LENGTH(X) (sizeof X / sizeof X[0])
+#define MAX_TARGETS 16
+#define MAX_BLOCKS  64
+#define MAX_CACHED  512 /* longest block string accepted from the cache */
+
+enum { TraceOff, TraceRecord, TraceReplay }; /* trace modes */
+enum { WatchConfig = 1<<0, WatchCgroup = 1<<1 }; /* watched files */
+enum { SensorFan = 1<<0, SensorCpu = 1<<1, SensorBattery = 1<<2, SensorCgroup = 1<<3, SensorAll = 0xf }; /* sensor groups */
+enum { RecTime = 't', RecFile = 'f', RecNoFile = 'n', RecSysinfo = 's', RecVolume = 'v', RecVisible = 'd', RecClock = 'u', RecWatch = 'w', RecTargets = 'l' }; /* trace record types */
 
 /* variables */
-static Display *dpy;
+static Target targets[MAX_TARGETS];
+static int ntargets;
+static uint64_t used;            // blocks shown on at least one target
+static volatile sig_atomic_t running = 1;
+static sigset_t sleep_mask;      // signal mask while sleeping
+
+static Config *conf;
+static char *config_file;
+static int watch_fd = -1;        // inotify instance
+static int config_wd = -1;
+static char *config_dir;         // directory of config_file
+static char *watched_dir;        // config_dir or its nearest existing parent
+static int cgroup_wd = -1;       // memory.events
+
+static int trace_mode = TraceOff;
+static FILE *trace_fd;
+static time_t trace_now;         // last timestamp read from the trace
+static const char trace_magic[] = "DWMTRACE5";
 
 static char* fan1_sensor;        // "/sys/class/hwmon/hwmon5/fan1_input"
 static char* fan2_sensor;        // "/sys/class/hwmon/hwmon5/fan2_input"
@@ -67,9 +204,24 @@ static char* bat_curr_sensor;    // "/sys/class/power_supply/BAT0/current_now"
 static char* bat_volt_sensor;    // "/sys/class/power_supply/BAT0/voltage_now"
 static char* bat_present_sensor; // "/sys/class/power_supply/BAT0/present"
 static char* bat_capa_sensor;    // "/sys/class/power_supply/BAT0/capacity"
+static int sensors_ready;
+
+static int cg_mem_fd = -1;       // memory.current
+static int cg_max_fd = -1;       // memory.max
+static int cg_swap_fd = -1;      // memory.swap.current
+static int cg_cpu_fd = -1;       // cpu.stat
 
-/* configuration */
+/* configuration, used when $XDG_CONFIG_HOME/dwmstatus/config does not exist */
 static const char bar_color[] = "#282828";
+static const char fan_hwmon[] = "dell_smm";
+static const char cpu_hwmon[] = "coretemp";
+static const char battery[] = "BAT0";
+static const char cgroup_root[] = "/sys/fs/cgroup";
+static const char config_name[] = "dwmstatus/config"; /* file in $XDG_CONFIG_HOME */
+static const char cache_name[] = "dwmstatus"; /* file in $XDG_CACHE_HOME holding the last status */
+static const int cache_interval = 60; /* seconds between two saves of a changed status */
+static const int dpms_poll = 5; /* seconds between DPMS checks while the displays are off */
+static const int reconnect_interval = 10; /* seconds between two attempts to open a lost display */
 
 static const Block blocks[] = {
     /* query:    function to call periodically
@@ -77,15 +229,28 @@ static const Block blocks[] = {
      * align:    align the interval with the specified epoch time if non zero
      * delay:    time to wait before the first call of the `query`.
      *           If -1 and align != 0, start immediately the `query` and align the next calls.
+     * background: keep calling `query` while no display is visible
      */
-    /* query      interval         align  delay */
-    { get_volume,       1,             0,   10 },
-    { get_ram,          60,            0,    0 },
-    { get_fan_speed,    20,            0,    0 },
-    { get_battery,      120,           0,    0 },
-    { get_power,        20,            0,    0 },
-    { get_temperature,  20,            0,    0 },
-    { get_time,         60,   1592384460,   -1 },
+    /* query      interval         align  delay  background */
+    { get_volume,       1,             0,   10,  0 },
+    { get_ram,          60,            0,    0,  0 },
+    { get_fan_speed,    20,            0,    0,  0 },
+    { get_battery,      120,           0,    0,  0 },
+    { get_power,        20,            0,    0,  1 }, /* keeps the averaging window meaningful */
+    { get_temperature,  20,            0,    0,  0 },
+    { get_time,         60,   1592384460,   -1,  0 },
+};
+
+/* names of the blocks in the configuration file */
+static const Query queries[] = {
+    { "volume",      get_volume },
+    { "ram",         get_ram },
+    { "fan",         get_fan_speed },
+    { "battery",     get_battery },
+    { "power",       get_power },
+    { "temperature", get_temperature },
+    { "time",        get_time },
+    { "cgroup",      get_cgroup },
 };
 
 
@@ -113,14 +278,96 @@ char* smprintf(char *fmt, ...)
     return ret;
 }
 
-void setstatus(char *str)
+/* Send the status to the target unless it already shows it */
+void setstatus(Target *t, char *str)
+{
+    if((trace_mode != TraceReplay && t->dpy == NULL) || (t->last != NULL && strcmp(t->last, str) == 0)){
+        return;
+    }
+    free(t->last);
+    t->last = smprintf("%s", str);
+
+    if(trace_mode == TraceReplay){
+        if(ntargets > 1){
+            printf("%lld %s %s\n", (long long)trace_now, t->name ? t->name : "-", str);
+        }else{
+            printf("%lld %s\n", (long long)trace_now, str);
+        }
+        return;
+    }
+    XStoreName(t->dpy, t->root, str);
+    XSync(t->dpy, False);
+}
+
+char* compose_status(uint64_t mask)
 {
-    XStoreName(dpy, DefaultRootWindow(dpy), str);
-    XSync(dpy, False);
+    size_t len = 0;
+    for(size_t i=0; i < conf->nentries; ++i){
+        if(conf->entries[i].string != NULL && (mask & (uint64_t)1<<i)){
+            len += strlen(conf->entries[i].string);
+        }
+    }
+
+    char *status = malloc(len + 1);
+    if(status == NULL){
+        perror("compose_status: malloc");
+        exit(1);
+    }
+    status[0] = 0;
+    for(size_t i=0, pos=0; i < conf->nentries; ++i){
+        if(conf->entries[i].string != NULL && (mask & (uint64_t)1<<i)){
+            strcpy(status+pos, conf->entries[i].string);
+            pos += strlen(conf->entries[i].string);
+        }
+    }
+    return status;
 }
 
-char* read_file(char *path)
+/* Format the last result of the block using status2d color codes. The
+ * color codes only depend on the colors, so they are rebuilt when the block
+ * color changes.
+ */
+void format_block(Entry *e)
 {
+    BlockData *data = &e->data;
+    const char *color = e->color[0] ? e->color : data->color;
+
+    if(e->seg_icon[0] == 0 || strcmp(color, e->seg_color) != 0){
+        snprintf(e->seg_color, sizeof(e->seg_color), "%s", color);
+        snprintf(e->seg_icon, sizeof(e->seg_icon), "^c%s^^b%s^ ", conf->bar_color, color);
+        snprintf(e->seg_text, sizeof(e->seg_text), " ^c%s^^b%s^", color, conf->bar_color);
+        snprintf(e->seg_plain, sizeof(e->seg_plain), "^c%s^^b%s^ ", color, conf->bar_color);
+    }
+
+    free(e->string);
+    if(strlen(data->icon) != 0 && strlen(data->text) != 0){
+        if(all_space(data->text)){
+            e->string = smprintf("%s%s%s%s", e->seg_icon, data->icon, e->seg_text, data->text);
+        }else{
+            e->string = smprintf("%s%s%s %s ", e->seg_icon, data->icon, e->seg_text, data->text);
+        }
+    }else if (strlen(data->icon) == 0 && strlen(data->text) != 0){
+        if(all_space(data->text)){
+            e->string = smprintf("%s", data->text);
+        }else{
+            e->string = smprintf("%s%s ", e->seg_plain, data->text);
+        }
+    }else if (strlen(data->icon) != 0 && strlen(data->text) == 0){
+        e->string = smprintf("%s%s ", e->seg_icon, data->icon);
+    }else{
+        e->string = smprintf("");
+    }
+}
+
+/* Return the content of the file, NULL on error. An empty file gives an
+ * empty string.
+ */
+char* load_file(char *path)
+{
+    char *content = NULL;
+    long int fsize;
+    size_t ret;
+
     if(!path){
         return NULL;
     }
@@ -133,39 +380,209 @@ char* read_file(char *path)
 
     if(fseek(fd, 0, SEEK_END) != 0){
         perror("fseek(SEEK_END)");
-        return NULL;
+        goto end;
     }
 
-    long int fsize = ftell(fd);
+    fsize = ftell(fd);
     if(fsize == -1){
         perror("ftell");
-        return NULL;
+        goto end;
     }
 
     if(fseek(fd, 0, SEEK_SET) != 0){
         perror("fseek(SEEK_SET)");
-        return NULL;
+        goto end;
     }
 
-    char *content = malloc(fsize + 1);
+    content = malloc(fsize + 1);
     if(content == NULL){
         perror("read_file: malloc");
-        return NULL;
+        goto end;
     }
 
-    size_t ret = fread(content, sizeof(char), fsize, fd);
+    ret = fread(content, sizeof(char), fsize, fd);
     /* Ignore cases when ret != fsize because /sys files always get fsize=4096 but a smaller real length */
-    if(ret == 0){
-        fprintf(stderr, "fread: bad return code (%ld instead of %ld) ", ret, fsize);
-        return NULL; 
+    if(ret == 0 && ferror(fd)){
+        fprintf(stderr, "fread: cannot read '%s'\n", path);
+        free(content);
+        content = NULL;
+        goto end;
     }
-
     content[ret] = 0;
+
+end:
     fclose(fd);
+    return content;
+}
+
+/* Every sensor read goes through read_file, read_sysinfo, read_volume or
+ * get_now so that it can be logged to, or served from, a trace.
+ */
+char* read_file(char *path)
+{
+    if(trace_mode == TraceReplay){
+        return trace_read(RecFile, NULL);
+    }
 
+    char *content = load_file(path);
+    if(trace_mode == TraceRecord){
+        trace_file(content);
+    }
+    return content;
+}
+
+/* Same as read_file for a file kept open */
+char* read_fd(int fd)
+{
+    if(trace_mode == TraceReplay){
+        return trace_read(RecFile, NULL);
+    }
+
+    char buf[4096];
+    char *content = NULL;
+    ssize_t len = fd != -1 ? pread(fd, buf, sizeof(buf)-1, 0) : -1;
+    if(len > 0){
+        buf[len] = 0;
+        content = smprintf("%s", buf);
+    }
+    if(trace_mode == TraceRecord){
+        trace_file(content);
+    }
     return content;
 }
 
+void trace_file(char *content)
+{
+    if(content == NULL){
+        trace_write(RecNoFile, NULL, 0);
+    }else{
+        trace_write(RecFile, content, strlen(content));
+    }
+}
+
+/* Only the result and the fields used by get_ram are traced */
+int read_sysinfo(struct sysinfo *s)
+{
+    int64_t fields[6];
+
+    if(trace_mode == TraceReplay){
+        trace_read_ints(RecSysinfo, fields, LENGTH(fields), 8);
+        memset(s, 0, sizeof(*s));
+        s->totalram  = fields[1];
+        s->freeram   = fields[2];
+        s->totalswap = fields[3];
+        s->freeswap  = fields[4];
+        s->mem_unit  = fields[5];
+        return fields[0];
+    }
+
+    int ret = sysinfo(s);
+    if(ret != 0){
+        perror("sysinfo");
+        memset(s, 0, sizeof(*s));
+    }
+    if(trace_mode == TraceRecord){
+        fields[0] = ret;
+        fields[1] = s->totalram;
+        fields[2] = s->freeram;
+        fields[3] = s->totalswap;
+        fields[4] = s->freeswap;
+        fields[5] = s->mem_unit;
+        trace_write_ints(RecSysinfo, fields, LENGTH(fields), 8);
+    }
+    return ret;
+}
+
+/* Raw value of the Master Playback Volume control, -1 on error */
+int read_volume(void)
+{
+    int64_t vol = -1;
+
+    if(trace_mode == TraceReplay){
+        trace_read_ints(RecVolume, &vol, 1, 4);
+        return vol;
+    }
+
+    snd_hctl_t *hctl;
+    snd_ctl_elem_id_t *id;
+    snd_ctl_elem_value_t *control;
+
+    // To find card and subdevice: /proc/asound/, aplay -L, amixer controls
+    if(snd_hctl_open(&hctl, "hw:0", 0)<0){
+        fprintf(stderr, "%s", "snd_hctl_open"); 
+        goto end;
+    }
+    if(snd_hctl_load(hctl)<0){
+        fprintf(stderr, "%s", "snd_hctl_load"); 
+        snd_hctl_close(hctl);
+        goto end;
+    }
+
+    snd_ctl_elem_id_alloca(&id);
+    snd_ctl_elem_id_set_interface(id, SND_CTL_ELEM_IFACE_MIXER);
+
+    // amixer controls
+    snd_ctl_elem_id_set_name(id, "Master Playback Volume");
+
+    snd_hctl_elem_t *elem = snd_hctl_find_elem(hctl, id);
+    if(elem == NULL){
+        fprintf(stderr, "%s", "snd_hctl_find_elem"); 
+        snd_hctl_close(hctl);
+        goto end;
+    }
+
+    snd_ctl_elem_value_alloca(&control);
+    snd_ctl_elem_value_set_id(control, id);
+
+    snd_hctl_elem_read(elem, control);
+    vol = snd_ctl_elem_value_get_integer(control,0);
+
+    snd_hctl_close(hctl);
+
+end:
+    if(trace_mode == TraceRecord){
+        trace_write_ints(RecVolume, &vol, 1, 4);
+    }
+    return vol;
+}
+
+/* Wall clock, virtual when replaying a trace */
+time_t get_now(void)
+{
+    int64_t now;
+
+    if(trace_mode == TraceReplay){
+        trace_read_ints(RecTime, &now, 1, 8);
+        trace_now = now;
+        return trace_now;
+    }
+
+    now = time(NULL);
+    if(trace_mode == TraceRecord){
+        trace_write_ints(RecTime, &now, 1, 8);
+    }
+    return now;
+}
+
+/* Monotonic clock in microseconds, virtual when replaying a trace */
+int64_t get_usec(void)
+{
+    int64_t usec;
+
+    if(trace_mode == TraceReplay){
+        trace_read_ints(RecClock, &usec, 1, 8);
+        return usec;
+    }
+
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    usec = ts.tv_sec*(int64_t)1000000 + ts.tv_nsec/1000;
+    if(trace_mode == TraceRecord){
+        trace_write_ints(RecClock, &usec, 1, 8);
+    }
+    return usec;
+}
+
 void get_time(BlockData* data)
 {
     char buf[129];
@@ -175,7 +592,7 @@ void get_time(BlockData* data)
     char *str;
     int hour = -1;
 
-    tim = time(NULL);
+    tim = get_now();
     timtm = localtime(&tim);
     if (timtm == NULL){
         str = smprintf("\uf071 ");
@@ -409,41 +826,11 @@ void get_volume(BlockData* data)
     strcpy(data->color, "#ebcb8b");
     strcpy(data->text, "\uf071 ");
 
-    int vol;
-    snd_hctl_t *hctl;
-    snd_ctl_elem_id_t *id;
-    snd_ctl_elem_value_t *control;
-
-    // To find card and subdevice: /proc/asound/, aplay -L, amixer controls
-    if(snd_hctl_open(&hctl, "hw:0", 0)<0){
-        fprintf(stderr, "%s", "snd_hctl_open"); 
-        return;
-    }
-    if(snd_hctl_load(hctl)<0){
-        fprintf(stderr, "%s", "snd_hctl_load"); 
-        return;
-    }
-
-    snd_ctl_elem_id_alloca(&id);
-    snd_ctl_elem_id_set_interface(id, SND_CTL_ELEM_IFACE_MIXER);
-
-    // amixer controls
-    snd_ctl_elem_id_set_name(id, "Master Playback Volume");
-
-    snd_hctl_elem_t *elem = snd_hctl_find_elem(hctl, id);
-    if(elem == NULL){
-        fprintf(stderr, "%s", "snd_hctl_find_elemooo"); 
+    int vol = read_volume();
+    if(vol < 0){
         return;
     }
 
-    snd_ctl_elem_value_alloca(&control);
-    snd_ctl_elem_value_set_id(control, id);
-
-    snd_hctl_elem_read(elem, control);
-    vol = (int)snd_ctl_elem_value_get_integer(control,0);
-
-    snd_hctl_close(hctl);
-
     /* The volume is in the range 0 - 127 but it follows
      * a pseudo logarithmic relation with the actual volume
      * (between 0 and 100%). No equation fits perfectly the
@@ -506,8 +893,7 @@ void get_ram(BlockData* data)
     strcpy(data->color, "#ebcb8b");
 
     struct sysinfo s;
-    if(sysinfo(&s) != 0){
-        perror("sysinfo");
+    if(read_sysinfo(&s) != 0){
         strcpy(data->text, "\uf071 ");
         return;
     }
@@ -558,9 +944,131 @@ void get_ram(BlockData* data)
 
 }
 
+char* format_size(unsigned long long bytes)
+{
+    unsigned long long mib = bytes/1048576;
+    if(mib > 1024){
+        return smprintf("%.1fG", mib / 1024.);
+    }
+    return smprintf("%lluM", mib);
+}
+
+/* Memory of our cgroup against its limit, and its CPU usage since the
+ * previous call. Runs early when memory.events changes.
+ */
+void get_cgroup(BlockData* data)
+{
+    static long long last_usage = -1;
+    static int64_t last_usec;
+
+    strcpy(data->icon, "\uf2db");
+    strcpy(data->color, "#b48ead");
+
+    char *file;
+    unsigned long long current, max = 0, swap = 0;
+
+    file = read_fd(cg_mem_fd);
+    if(file == NULL){
+        strcpy(data->text, "\uf071 ");
+        return;
+    }
+    current = strtoull(file, NULL, 10);
+    free(file);
+
+    /* "max" when there is no limit */
+    file = read_fd(cg_max_fd);
+    if(file != NULL){
+        max = strtoull(file, NULL, 10);
+        free(file);
+    }
+
+    file = read_fd(cg_swap_fd);
+    if(file != NULL){
+        swap = strtoull(file, NULL, 10);
+        free(file);
+    }
+
+    long long usage = -1;
+    file = read_fd(cg_cpu_fd);
+    if(file != NULL){
+        char *field = strstr(file, "usage_usec ");
+        if(field != NULL){
+            usage = strtoll(field + strlen("usage_usec "), NULL, 10);
+        }
+        free(file);
+    }
+    int64_t usec = get_usec();
+
+    char *mem_str = format_size(current);
+    char *str;
+    if(max != 0){
+        char *max_str = format_size(max);
+        str = smprintf("%s/%s", mem_str, max_str);
+        free(max_str);
+        if(current*10 >= max*9){
+            strcpy(data->color, "#bf616a");
+        }
+    }else{
+        str = smprintf("%s", mem_str);
+    }
+    free(mem_str);
+
+    if(swap != 0){
+        char *swap_str = format_size(swap);
+        char *tmp = smprintf("%s S: %s", str, swap_str);
+        free(swap_str);
+        free(str);
+        str = tmp;
+    }
+
+    if(usage != -1 && last_usage != -1 && usec > last_usec){
+        char *tmp = smprintf("%s %.0f%%", str, (usage-last_usage)*100. / (usec-last_usec));
+        free(str);
+        str = tmp;
+    }
+    last_usage = usage;
+    last_usec = usec;
+
+    snprintf(data->text, sizeof(data->text), "%s", str);
+    free(str);
+}
+
+/* Sleep until the given time, forever if -1, or until an X event or a
+ * signal arrives. The signals are blocked outside of this sleep so that
+ * one received since the last check of `running` ends it right away.
+ */
 void sleep_until(time_t seconds)
 {
-    sleep(seconds-time(NULL));
+    fd_set fds;
+    int maxfd = -1;
+    struct timespec ts;
+    struct timespec *timeout = NULL;
+
+    FD_ZERO(&fds);
+    if(watch_fd != -1){
+        FD_SET(watch_fd, &fds);
+        maxfd = watch_fd;
+    }
+    for(int i=0; i < ntargets; ++i){
+        if(targets[i].dpy != NULL && !targets[i].lost){
+            if(XQLength(targets[i].dpy) > 0){
+                return;
+            }
+            int fd = ConnectionNumber(targets[i].dpy);
+            FD_SET(fd, &fds);
+            if(fd > maxfd){
+                maxfd = fd;
+            }
+        }
+    }
+
+    if(seconds != -1){
+        time_t now = time(NULL);
+        ts.tv_sec = seconds > now ? seconds-now : 0;
+        ts.tv_nsec = 0;
+        timeout = &ts;
+    }
+    pselect(maxfd+1, &fds, NULL, NULL, timeout, &sleep_mask);
 }
 
 int all_space(char *str)
@@ -598,7 +1106,7 @@ char* find_in_dir(char* path, char* hwmon_name, char* file)
             if(dir->d_type == DT_REG){
                 if(!good_name && strcmp(dir->d_name, "name") == 0){
                     char* name_path = smprintf("%s/name", path);
-                    char* content = read_file(name_path);
+                    char* content = load_file(name_path);
                     bad_name = 1;
                     if(content != NULL){
                         strip(content);
@@ -646,139 +1154,1278 @@ char* find_sensor(char* path, char* hwmon_name, char* file)
     return found_path;
 }
 
-void detect_sensors(void)
+/* Find the sensors of the given groups, each one depends on its own
+ * configuration setting.
+ */
+void detect_sensors(int groups)
 {
-    fan1_sensor         = find_sensor("/sys/class/hwmon", "dell_smm", "fan1_input");
-    fan2_sensor         = find_sensor("/sys/class/hwmon", "dell_smm", "fan2_input");
-    cpu_sensor          = find_sensor("/sys/class/hwmon", "coretemp", "temp1_input");
-
-    bat_status_sensor   = smprintf("/sys/class/power_supply/BAT0/status");
-    bat_curr_sensor     = smprintf("/sys/class/power_supply/BAT0/current_now");
-    bat_volt_sensor     = smprintf("/sys/class/power_supply/BAT0/voltage_now");
-    bat_present_sensor  = smprintf("/sys/class/power_supply/BAT0/present");
-    bat_capa_sensor     = smprintf("/sys/class/power_supply/BAT0/capacity");
+    if(groups & SensorFan){
+        fan1_sensor     = find_sensor("/sys/class/hwmon", conf->fan_hwmon, "fan1_input");
+        fan2_sensor     = find_sensor("/sys/class/hwmon", conf->fan_hwmon, "fan2_input");
+    }
+    if(groups & SensorCpu){
+        cpu_sensor      = find_sensor("/sys/class/hwmon", conf->cpu_hwmon, "temp1_input");
+    }
+    if(groups & SensorBattery){
+        bat_status_sensor   = smprintf("/sys/class/power_supply/%s/status", conf->battery);
+        bat_curr_sensor     = smprintf("/sys/class/power_supply/%s/current_now", conf->battery);
+        bat_volt_sensor     = smprintf("/sys/class/power_supply/%s/voltage_now", conf->battery);
+        bat_present_sensor  = smprintf("/sys/class/power_supply/%s/present", conf->battery);
+        bat_capa_sensor     = smprintf("/sys/class/power_supply/%s/capacity", conf->battery);
+    }
+    if((groups & SensorCgroup) && has_query(conf, get_cgroup)){
+        open_cgroup();
+    }
+    sensors_ready = 1;
 }
 
-void free_sensors(void)
+void free_sensors(int groups)
 {
-    free(fan1_sensor);
-    free(fan2_sensor);
-    free(cpu_sensor);
-    free(bat_status_sensor);
-    free(bat_curr_sensor);
-    free(bat_volt_sensor);
-    free(bat_present_sensor);
-    free(bat_capa_sensor);
+    if(groups & SensorFan){
+        free(fan1_sensor);
+        free(fan2_sensor);
+        fan1_sensor = fan2_sensor = NULL;
+    }
+    if(groups & SensorCpu){
+        free(cpu_sensor);
+        cpu_sensor = NULL;
+    }
+    if(groups & SensorBattery){
+        free(bat_status_sensor);
+        free(bat_curr_sensor);
+        free(bat_volt_sensor);
+        free(bat_present_sensor);
+        free(bat_capa_sensor);
+        bat_status_sensor = bat_curr_sensor = bat_volt_sensor = NULL;
+        bat_present_sensor = bat_capa_sensor = NULL;
+    }
+    if(groups & SensorCgroup){
+        close_cgroup();
+    }
 }
 
-int main(void)
+int open_cgroup_file(char *dir, char *file)
 {
-    if (!(dpy = XOpenDisplay(NULL))) {
-        fprintf(stderr, "dwmstatus: cannot open display.\n");
-        return 1;
+    char *path = smprintf("%s/%s", dir, file);
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if(fd == -1){
+        fprintf(stderr, "dwmstatus: cannot open '%s'.\n", path);
     }
+    free(path);
+    return fd;
+}
 
-    BlockData data;
-    char status[LENGTH(blocks)*128];
-
-    /* flags:
-     * 0x01 -> call it now
-     */ 
-    int flags[LENGTH(blocks)] = {0};
-
-    time_t next_update[LENGTH(blocks)];
-    char* block_strings[LENGTH(blocks)];
-
-    time_t now = time(NULL);
-    for(int i=0; i < LENGTH(blocks); ++i){
-        if(blocks[i].align != 0){
-            time_t delta = now - blocks[i].align;
-            double passed = delta / (double)blocks[i].interval;
-            next_update[i] = ceil(passed)*blocks[i].interval + blocks[i].align + blocks[i].delay;
-           
-            if(blocks[i].delay == -1){
-                flags[i] |= 1<<0;
-                next_update[i] += 1;
-            }
+/* Our cgroup is the "0::<path>" line of /proc/self/cgroup */
+void open_cgroup(void)
+{
+    char *dir;
 
-        }else{
-            next_update[i] = now+blocks[i].delay;
+    if(conf->cgroup[0] != 0){
+        dir = smprintf("%s/%s", conf->cgroup_root, conf->cgroup);
+    }else{
+        char *content = load_file("/proc/self/cgroup");
+        char *line = content ? strstr(content, "0::") : NULL;
+        if(line == NULL || (line != content && line[-1] != '\n')){
+            fprintf(stderr, "dwmstatus: no cgroup v2 hierarchy.\n");
+            free(content);
+            return;
         }
-        block_strings[i] = NULL;
+        line += strlen("0::");
+        line[strcspn(line, "\n")] = 0;
+        dir = smprintf("%s%s", conf->cgroup_root, line);
+        free(content);
     }
 
-    detect_sensors();
+    cg_mem_fd  = open_cgroup_file(dir, "memory.current");
+    cg_max_fd  = open_cgroup_file(dir, "memory.max");
+    cg_swap_fd = open_cgroup_file(dir, "memory.swap.current");
+    cg_cpu_fd  = open_cgroup_file(dir, "cpu.stat");
 
-    while(1){
+    /* cgroupfs reports the memory.events changes as modifications */
+    char *events = smprintf("%s/memory.events", dir);
+    cgroup_wd = add_watch(events, IN_MODIFY);
+    free(events);
+    free(dir);
+}
 
-        /* Run tasks and update next_update if needed */
-        now = time(NULL);
-        int changed = 0;
-        for(int i=0; i < LENGTH(blocks); ++i){
+void close_cgroup(void)
+{
+    int *fds[] = { &cg_mem_fd, &cg_max_fd, &cg_swap_fd, &cg_cpu_fd };
+    for(size_t i=0; i < LENGTH(fds); ++i){
+        if(*fds[i] != -1){
+            close(*fds[i]);
+            *fds[i] = -1;
+        }
+    }
+    if(cgroup_wd != -1){
+        inotify_rm_watch(watch_fd, cgroup_wd);
+        cgroup_wd = -1;
+    }
+}
 
-            if (next_update[i] <= now || (flags[i] & (1<<0) )){
+char* cache_path(void)
+{
+    char *dir = getenv("XDG_CACHE_HOME");
+    if(dir != NULL && dir[0] != 0){
+        return smprintf("%s/%s", dir, cache_name);
+    }
+    dir = getenv("HOME");
+    if(dir == NULL){
+        return NULL;
+    }
+    return smprintf("%s/.cache/%s", dir, cache_name);
+}
 
-                /* Query informations and format them using status2d color codes */
-                blocks[i].query(&data);
-
-                free(block_strings[i]);
-                if(strlen(data.icon) != 0 && strlen(data.text) != 0){
-                    if(all_space(data.text)){
-                        block_strings[i] = smprintf("^c%s^^b%s^ %s ^c%s^^b%s^%s", bar_color, data.color, data.icon, data.color, bar_color, data.text);
-                    }else{
-                        block_strings[i] = smprintf("^c%s^^b%s^ %s ^c%s^^b%s^ %s ", bar_color, data.color, data.icon, data.color, bar_color, data.text);
-                    }
-                }else if (strlen(data.icon) == 0 && strlen(data.text) != 0){
-                    if(all_space(data.text)){
-                        block_strings[i] = smprintf("%s", data.text);
-                    }else{
-                        block_strings[i] = smprintf("^c%s^^b%s^ %s ", data.color, bar_color, data.text);
-                    }
-                }else if (strlen(data.icon) != 0 && strlen(data.text) == 0){
-                    block_strings[i] = smprintf("^c%s^^b%s^ %s ", bar_color, data.color, data.icon);
-                }else{
-                    block_strings[i] = smprintf("");
-                }
+/* The cache holds one formatted block string per line, preceded by the
+ * number of blocks. Each line starts with the name and the interval of its
+ * block so that a cache written for another configuration is ignored. So is
+ * a cache with overlong lines.
+ */
+int load_cache(Config *c)
+{
+    size_t n = c->nentries;
+    char *path = cache_path();
+    if(path == NULL){
+        return 0;
+    }
+    FILE *fd = fopen(path, "r");
+    free(path);
+    if(fd == NULL){
+        return 0;
+    }
 
-                /* normal case */
-                if (next_update[i] <= now){
-                    next_update[i] += blocks[i].interval;
-                }
-                if(flags[i] & (1<<0)){
-                    flags[i] &= ~(1<<0);
-                }
+    char *line = NULL;
+    size_t cap = 0;
+    ssize_t len;
+    size_t count = 0;
 
-                changed = 1;
-            }
+    if(getline(&line, &cap, fd) <= 0 || sscanf(line, "dwmstatus %zu", &count) != 1 || count != n){
+        free(line);
+        fclose(fd);
+        return 0;
+    }
 
+    size_t i = 0;
+    while(i < n && (len = getline(&line, &cap, fd)) > 0 && len <= MAX_CACHED){
+        Entry *e = &c->entries[i];
+        char name[16];
+        int interval, pos;
+        strip(line);
+        if(sscanf(line, "%15s %d%n", name, &interval, &pos) != 2 || line[pos] != ' '
+            || strcmp(name, query_name(e->query)) != 0 || interval != e->interval){
+            break;
         }
+        e->string = smprintf("%s", line+pos+1);
+        ++i;
+    }
+    free(line);
+    fclose(fd);
 
-        /* Update status */
-        if(changed){
-            memset(status, 0, sizeof(status));
-            for(int i=0; i < LENGTH(blocks); ++i){
-                if(block_strings[i] != NULL){
-                    strcat(status, block_strings[i]);
-                }
-            }
-            setstatus(status);
+    if(i != n){
+        while(i > 0){
+            --i;
+            free(c->entries[i].string);
+            c->entries[i].string = NULL;
         }
-
-        /* Determine how long we can sleep */
-        time_t min_next = next_update[0];
-        for(int i=1; i < LENGTH(blocks); ++i){
-            if (next_update[i] < min_next){
-                min_next = next_update[i];
+        return 0;
+    }
+    return 1;
+}
+
+/* The cache is written next to its final path then renamed, so that it is
+ * never seen half written.
+ */
+void save_cache(Config *c)
+{
+    char *path = cache_path();
+    if(path == NULL){
+        return;
+    }
+
+    char *dir = smprintf("%s", path);
+    *strrchr(dir, '/') = 0;
+    if(mkdir(dir, 0700) != 0 && errno != EEXIST){
+        perror("save_cache: mkdir");
+    }
+    free(dir);
+
+    char *tmp = smprintf("%s.tmp", path);
+    FILE *fd = fopen(tmp, "w");
+    if(fd == NULL){
+        perror("save_cache: fopen");
+        free(tmp);
+        free(path);
+        return;
+    }
+
+    fprintf(fd, "dwmstatus %zu\n", c->nentries);
+    for(size_t i=0; i < c->nentries; ++i){
+        Entry *e = &c->entries[i];
+        fprintf(fd, "%s %d %s\n", query_name(e->query), e->interval, e->string ? e->string : "");
+    }
+    if(fclose(fd) != 0 || rename(tmp, path) != 0){
+        perror("save_cache");
+        unlink(tmp);
+    }
+    free(tmp);
+    free(path);
+}
+
+char* config_path(void)
+{
+    char *dir = getenv("XDG_CONFIG_HOME");
+    if(dir != NULL && dir[0] != 0){
+        return smprintf("%s/%s", dir, config_name);
+    }
+    dir = getenv("HOME");
+    if(dir == NULL){
+        return NULL;
+    }
+    return smprintf("%s/.config/%s", dir, config_name);
+}
+
+Config* new_config(size_t n)
+{
+    Config *c = calloc(1, sizeof(Config) + n*sizeof(Entry));
+    if(c == NULL){
+        perror("new_config: calloc");
+        exit(1);
+    }
+    strcpy(c->bar_color, bar_color);
+    strcpy(c->fan_hwmon, fan_hwmon);
+    strcpy(c->cpu_hwmon, cpu_hwmon);
+    strcpy(c->battery, battery);
+    strcpy(c->cgroup_root, cgroup_root);
+    return c;
+}
+
+Config* default_config(void)
+{
+    Config *c = new_config(LENGTH(blocks));
+    c->nentries = LENGTH(blocks);
+    for(size_t i=0; i < LENGTH(blocks); ++i){
+        c->entries[i].query      = blocks[i].query;
+        c->entries[i].interval   = blocks[i].interval;
+        c->entries[i].align      = blocks[i].align;
+        c->entries[i].delay      = blocks[i].delay;
+        c->entries[i].background = blocks[i].background;
+    }
+    return c;
+}
+
+/* The configuration file is made of lines like
+ *     bar_color #282828
+ *     fan_hwmon dell_smm
+ *     cpu_hwmon coretemp
+ *     battery   BAT0
+ *     cgroup_root /sys/fs/cgroup
+ *     cgroup    <path in cgroup_root>
+ *     block     <name> <interval> <align> <delay> [#color] [background]
+ * with blocks in display order. Lines starting with '#' are comments.
+ * `text` is modified. Return NULL if it is invalid.
+ */
+Config* parse_config(char *text, char *name)
+{
+    Config *c = new_config(MAX_BLOCKS);
+    char *line;
+    char *next = text;
+    int lineno = 0;
+    const char *error = NULL;
+
+    while(error == NULL && (line = next) != NULL){
+        next = strchr(line, '\n');
+        if(next != NULL){
+            *next++ = 0;
+        }
+        ++lineno;
+        char *key = strtok(line, " \t");
+        if(key == NULL || key[0] == '#'){
+            continue;
+        }
+        char *value = strtok(NULL, " \t");
+        if(value == NULL){
+            error = "missing value";
+            break;
+        }
+
+        char *dest = NULL;
+        size_t size = 0;
+        if(!strcmp(key, "bar_color")){
+            dest = c->bar_color;
+            size = sizeof(c->bar_color);
+        }else if(!strcmp(key, "fan_hwmon")){
+            dest = c->fan_hwmon;
+            size = sizeof(c->fan_hwmon);
+        }else if(!strcmp(key, "cpu_hwmon")){
+            dest = c->cpu_hwmon;
+            size = sizeof(c->cpu_hwmon);
+        }else if(!strcmp(key, "battery")){
+            dest = c->battery;
+            size = sizeof(c->battery);
+        }else if(!strcmp(key, "cgroup_root")){
+            dest = c->cgroup_root;
+            size = sizeof(c->cgroup_root);
+        }else if(!strcmp(key, "cgroup")){
+            dest = c->cgroup;
+            size = sizeof(c->cgroup);
+        }else if(strcmp(key, "block") != 0){
+            error = "unknown option";
+            break;
+        }
+        if(dest != NULL){
+            if(strlen(value) >= size){
+                error = "value too long";
+            }else{
+                strcpy(dest, value);
             }
+            continue;
         }
 
-        sleep_until(min_next);
+        if(c->nentries == MAX_BLOCKS){
+            error = "too many blocks";
+            break;
+        }
+        Entry *e = &c->entries[c->nentries];
+        for(size_t i=0; i < LENGTH(queries); ++i){
+            if(!strcmp(value, queries[i].name)){
+                e->query = queries[i].query;
+            }
+        }
+        if(e->query == NULL){
+            error = "unknown block";
+            break;
+        }
+
+        char *fields[3];
+        long numbers[3];
+        char *end;
+        for(int i=0; i < 3 && error == NULL; ++i){
+            fields[i] = strtok(NULL, " \t");
+            if(fields[i] == NULL){
+                error = "block needs an interval, an align and a delay";
+            }else{
+                numbers[i] = strtol(fields[i], &end, 10);
+                if(*end != 0){
+                    error = "bad number";
+                }
+            }
+        }
+        if(error == NULL && numbers[0] <= 0){
+            error = "interval must be positive";
+        }
+        if(error != NULL){
+            break;
+        }
+        e->interval = numbers[0];
+        e->align    = numbers[1];
+        e->delay    = numbers[2];
+
+        while((value = strtok(NULL, " \t")) != NULL){
+            if(!strcmp(value, "background")){
+                e->background = 1;
+            }else if(value[0] != '#' || strlen(value) >= sizeof(e->color)){
+                error = "bad block option";
+            }else{
+                strcpy(e->color, value);
+            }
+        }
+        ++c->nentries;
+    }
+
+    if(error == NULL && c->nentries == 0){
+        error = "no block";
+    }
+    if(error != NULL){
+        fprintf(stderr, "dwmstatus: %s:%d: %s.\n", name, lineno, error);
+        free(c);
+        return NULL;
+    }
+
+    /* Keep the table compact */
+    Config *shrunk = realloc(c, sizeof(Config) + c->nentries*sizeof(Entry));
+    return shrunk ? shrunk : c;
+}
+
+/* Parse the configuration file. Its content is stored in the trace so that
+ * a replay uses the configuration of the recording, not the local one.
+ * Return NULL if there is no file or it is invalid.
+ */
+Config* read_config(void)
+{
+    char *text;
+
+    if(trace_mode == TraceReplay){
+        text = trace_read(RecFile, NULL);
+    }else{
+        text = config_file != NULL && access(config_file, F_OK) == 0 ? load_file(config_file) : NULL;
+        if(trace_mode == TraceRecord){
+            trace_file(text);
+        }
+    }
+    if(text == NULL){
+        return NULL;
+    }
+
+    Config *c = parse_config(text, trace_mode == TraceReplay ? "trace" : config_file);
+    free(text);
+    return c;
+}
+
+void free_config(Config *c)
+{
+    if(c == NULL){
+        return;
+    }
+    for(size_t i=0; i < c->nentries; ++i){
+        free(c->entries[i].string);
+    }
+    free(c);
+}
+
+void schedule(Entry *e, time_t now)
+{
+    e->flags = 0;
+    if(e->align != 0){
+        time_t delta = now - e->align;
+        double passed = delta / (double)e->interval;
+        e->next_update = ceil(passed)*e->interval + e->align + e->delay;
+
+        if(e->delay == -1){
+            e->flags |= 1<<0;
+            e->next_update += 1;
+        }
+
+    }else{
+        e->next_update = now+e->delay;
     }
+}
 
-    XCloseDisplay(dpy);
+/* Install a new configuration. The blocks that did not change keep their
+ * schedule and their last string, the other ones start over but show the
+ * last string of a block with the same query until they run.
+ */
+void apply_config(Config *c, time_t now)
+{
+    Config *old = conf;
+    char taken[MAX_BLOCKS] = {0};
+    int new_bar = old == NULL || strcmp(old->bar_color, c->bar_color) != 0;
+
+    for(size_t i=0; i < c->nentries; ++i){
+        Entry *e = &c->entries[i];
+        Entry *same = NULL;
+        Entry *similar = NULL;
+
+        for(size_t j=0; old != NULL && j < old->nentries && same == NULL; ++j){
+            Entry *o = &old->entries[j];
+            if(taken[j] || o->query != e->query){
+                continue;
+            }
+            if(o->interval == e->interval && o->align == e->align && o->delay == e->delay
+                && o->background == e->background && !strcmp(o->color, e->color)){
+                same = o;
+                taken[j] = 1;
+            }else if(similar == NULL){
+                similar = o;
+            }
+        }
 
-    free_sensors();
+        if(same != NULL){
+            *e = *same;
+            same->string = NULL;
+            /* Only the format changes, the block is not queried again */
+            if(new_bar){
+                e->seg_icon[0] = 0;
+                if(e->data.color[0] == 0){
+                    e->flags |= 1<<0;
+                }
+            }
+        }else{
+            schedule(e, now);
+            if(similar != NULL){
+                e->string = similar->string;
+                similar->string = NULL;
+            }
+        }
+    }
 
+    conf = c;
+    if(new_bar){
+        for(size_t i=0; i < c->nentries; ++i){
+            if(c->entries[i].data.color[0] != 0){
+                format_block(&c->entries[i]);
+            }
+        }
+    }
+
+    /* Only the sensors whose setting changed are looked for again */
+    if(old != NULL && sensors_ready && trace_mode != TraceReplay){
+        int groups = 0;
+        if(strcmp(old->fan_hwmon, c->fan_hwmon) != 0){
+            groups |= SensorFan;
+        }
+        if(strcmp(old->cpu_hwmon, c->cpu_hwmon) != 0){
+            groups |= SensorCpu;
+        }
+        if(strcmp(old->battery, c->battery) != 0){
+            groups |= SensorBattery;
+        }
+        if(strcmp(old->cgroup_root, c->cgroup_root) != 0 || strcmp(old->cgroup, c->cgroup) != 0
+            || has_query(old, get_cgroup) != has_query(c, get_cgroup)){
+            groups |= SensorCgroup;
+        }
+        free_sensors(groups);
+        detect_sensors(groups);
+    }
+    size_t old_count = old ? old->nentries : c->nentries;
+    free_config(old);
+
+    /* Blocks shown nowhere are never queried. -b picks blocks by their
+     * position in the configuration, which a reload may have moved.
+     */
+    int picked = 0;
+    used = 0;
+    for(int i=0; i < ntargets; ++i){
+        targets[i].dirty = 1;
+        used |= targets[i].mask;
+        picked |= targets[i].mask != ~(uint64_t)0;
+    }
+    if(picked && old_count != c->nentries){
+        fprintf(stderr, "dwmstatus: the number of blocks changed from %zu to %zu, check the -b options.\n", old_count, c->nentries);
+    }
+}
+
+int has_query(Config *c, void (*query)(BlockData*))
+{
+    for(size_t i=0; i < c->nentries; ++i){
+        if(c->entries[i].query == query){
+            return 1;
+        }
+    }
     return 0;
 }
 
+/* Name of the query in the configuration file */
+const char* query_name(void (*query)(BlockData*))
+{
+    for(size_t i=0; i < LENGTH(queries); ++i){
+        if(queries[i].query == query){
+            return queries[i].name;
+        }
+    }
+    return "?";
+}
+
+/* Return the watch descriptor, -1 on error */
+int add_watch(char *path, uint32_t mask)
+{
+    if(watch_fd == -1 && (watch_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC)) == -1){
+        perror("inotify_init1");
+        return -1;
+    }
+    int wd = inotify_add_watch(watch_fd, path, mask);
+    if(wd == -1){
+        fprintf(stderr, "dwmstatus: cannot watch '%s'.\n", path);
+    }
+    return wd;
+}
+
+char* parent_dir(char *path)
+{
+    char *dir = smprintf("%s", path);
+    char *slash = strrchr(dir, '/');
+    if(slash == NULL){
+        free(dir);
+        return smprintf(".");
+    }
+    slash[slash == dir] = 0;
+    return dir;
+}
+
+/* Editors usually replace the file, so its directory is watched. Until the
+ * directory exists, its nearest existing parent is watched for its creation.
+ */
+void watch_config(void)
+{
+    if(config_dir == NULL){
+        config_dir = parent_dir(config_file);
+    }
+
+    char *dir = smprintf("%s", config_dir);
+    while(access(dir, F_OK) != 0){
+        char *up = parent_dir(dir);
+        if(!strcmp(up, dir)){
+            free(up);
+            break;
+        }
+        free(dir);
+        dir = up;
+    }
+
+    if(watched_dir != NULL && config_wd != -1 && !strcmp(dir, watched_dir)){
+        free(dir);
+        return;
+    }
+    if(config_wd != -1){
+        inotify_rm_watch(watch_fd, config_wd);
+    }
+    free(watched_dir);
+    watched_dir = dir;
+    config_wd = add_watch(dir, IN_CLOSE_WRITE | IN_MOVED_TO | IN_CREATE);
+}
+
+/* Return the Watch* flags of the watched files that changed */
+int read_watches(void)
+{
+    union {
+        struct inotify_event ev;
+        char buf[4096];
+    } u;
+    ssize_t len;
+    int64_t changes = 0;
+    int rewatch = 0;
+
+    /* The changes trigger early queries, so they are part of the trace */
+    if(trace_mode == TraceReplay){
+        trace_read_ints(RecWatch, &changes, 1, 4);
+        return changes;
+    }
+    if(watch_fd == -1){
+        goto end;
+    }
+
+    char *base = config_file ? strrchr(config_file, '/') : NULL;
+    base = base ? base+1 : config_file;
+
+    while((len = read(watch_fd, u.buf, sizeof(u.buf))) > 0){
+        for(char *p = u.buf; p < u.buf + len; ){
+            struct inotify_event *ev = (struct inotify_event*)p;
+            if(ev->wd == config_wd && config_wd != -1){
+                if(ev->mask & IN_IGNORED){
+                    config_wd = -1;
+                    rewatch = 1;
+                }else if(strcmp(watched_dir, config_dir) != 0){
+                    rewatch = 1;
+                }else if(ev->len != 0 && !strcmp(ev->name, base) && (ev->mask & (IN_CLOSE_WRITE | IN_MOVED_TO))){
+                    changes |= WatchConfig;
+                }
+            }else if(ev->wd == cgroup_wd && cgroup_wd != -1){
+                changes |= WatchCgroup;
+            }
+            p += sizeof(*ev) + ev->len;
+        }
+    }
+
+    /* A directory on the way to the configuration appeared or vanished */
+    if(rewatch){
+        watch_config();
+        if(!strcmp(watched_dir, config_dir) && access(config_file, F_OK) == 0){
+            changes |= WatchConfig;
+        }
+    }
+
+end:
+    if(trace_mode == TraceRecord){
+        trace_write_ints(RecWatch, &changes, 1, 4);
+    }
+    return changes;
+}
+
+void apply_watches(int watches, time_t now)
+{
+    Config *c;
+
+    if((watches & WatchConfig) && (c = read_config()) != NULL){
+        apply_config(c, now);
+        fprintf(stderr, "dwmstatus: configuration reloaded.\n");
+    }
+    /* memory.events: high, max or oom happened */
+    if(watches & WatchCgroup){
+        for(size_t i=0; i < conf->nentries; ++i){
+            if(conf->entries[i].query == get_cgroup){
+                conf->entries[i].flags |= 1<<0;
+            }
+        }
+    }
+}
+
+/* A trace is the magic string followed by records made of a one byte
+ * type, a 32 bits payload length and the payload. The length and the
+ * integers of the payloads are stored in little endian.
+ */
+int trace_open(char *path, int mode)
+{
+    char magic[sizeof(trace_magic)];
+
+    trace_fd = fopen(path, mode == TraceRecord ? "wb" : "rb");
+    if(trace_fd == NULL){
+        perror("trace_open: fopen");
+        return 0;
+    }
+    if(mode == TraceRecord){
+        fwrite(trace_magic, 1, sizeof(trace_magic), trace_fd);
+    }else if(fread(magic, 1, sizeof(magic), trace_fd) != sizeof(magic) || memcmp(magic, trace_magic, sizeof(magic)) != 0){
+        fprintf(stderr, "dwmstatus: '%s' is not a trace.\n", path);
+        fclose(trace_fd);
+        return 0;
+    }
+    trace_mode = mode;
+    return 1;
+}
+
+void trace_close(void)
+{
+    if(trace_fd != NULL){
+        fclose(trace_fd);
+        trace_fd = NULL;
+    }
+}
+
+void trace_write(int type, const void *buf, uint32_t len)
+{
+    uint8_t head[5] = { type, len, len >> 8, len >> 16, len >> 24 };
+    if(fwrite(head, sizeof(head), 1, trace_fd) != 1
+        || (len != 0 && fwrite(buf, len, 1, trace_fd) != 1)){
+        perror("trace_write");
+        trace_close();
+        trace_mode = TraceOff;
+    }
+}
+
+/* Return the payload of the next record, NUL terminated, or NULL for a
+ * failed file read. The replay ends with the trace.
+ */
+void* trace_read(int type, uint32_t *len)
+{
+    uint8_t head[5];
+
+    if(fread(head, sizeof(head), 1, trace_fd) != 1){
+        fflush(stdout);
+        trace_close();
+        exit(0);
+    }
+    uint8_t t = head[0];
+    uint32_t l = head[1] | head[2] << 8 | head[3] << 16 | (uint32_t)head[4] << 24;
+    if(t != type && !(type == RecFile && t == RecNoFile)){
+        fprintf(stderr, "dwmstatus: trace out of sync (record '%c' instead of '%c').\n", t, type);
+        exit(1);
+    }
+    if(len != NULL){
+        *len = l;
+    }
+    if(t == RecNoFile){
+        return NULL;
+    }
+
+    char *buf = malloc(l + 1);
+    if(buf == NULL){
+        perror("trace_read: malloc");
+        exit(1);
+    }
+    if(l != 0 && fread(buf, l, 1, trace_fd) != 1){
+        fprintf(stderr, "dwmstatus: truncated trace.\n");
+        exit(1);
+    }
+    buf[l] = 0;
+    return buf;
+}
+
+/* Write `count` integers of `width` bytes */
+void trace_write_ints(int type, const int64_t *values, int count, int width)
+{
+    uint8_t buf[64];
+    for(int i=0; i < count; ++i){
+        for(int b=0; b < width; ++b){
+            buf[i*width + b] = (uint64_t)values[i] >> 8*b;
+        }
+    }
+    trace_write(type, buf, count*width);
+}
+
+/* Read a record written by trace_write_ints */
+void trace_read_ints(int type, int64_t *values, int count, int width)
+{
+    uint32_t len;
+    uint8_t *rec = trace_read(type, &len);
+    if(len != (uint32_t)(count*width)){
+        fprintf(stderr, "dwmstatus: truncated trace.\n");
+        exit(1);
+    }
+    for(int i=0; i < count; ++i){
+        uint64_t v = 0;
+        for(int b=0; b < width; ++b){
+            v |= (uint64_t)rec[i*width + b] << 8*b;
+        }
+        /* sign extension */
+        if(width < 8 && (v >> (8*width-1)) & 1){
+            v |= ~(uint64_t)0 << 8*width;
+        }
+        values[i] = v;
+    }
+    free(rec);
+}
+
+void terminate(int signo)
+{
+    running = 0;
+}
+
+void usage(void)
+{
+    fprintf(stderr, "usage: dwmstatus [-c config] [-d display [-b block,...]]... [-r trace | -p trace]\n");
+    exit(1);
+}
+
+/* Comma separated block indexes to a mask, 0 if invalid */
+uint64_t parse_blocks(char *list)
+{
+    uint64_t mask = 0;
+    char *end;
+
+    while(*list){
+        long i = strtol(list, &end, 10);
+        if(end == list || i < 0 || i >= MAX_BLOCKS || (*end != ',' && *end != 0)){
+            return 0;
+        }
+        mask |= (uint64_t)1<<i;
+        list = *end ? end+1 : end;
+    }
+    return mask;
+}
+
+/* The targets decide which blocks run and how the visibility is read, so
+ * a replay uses the ones of the recording: their number, then the blocks
+ * and the display name of each one.
+ */
+void trace_targets(void)
+{
+    int64_t value;
+
+    if(trace_mode == TraceReplay){
+        trace_read_ints(RecTargets, &value, 1, 4);
+        if(value < 1 || value > MAX_TARGETS){
+            fprintf(stderr, "dwmstatus: bad number of displays in the trace.\n");
+            exit(1);
+        }
+        ntargets = value;
+        for(int i=0; i < ntargets; ++i){
+            trace_read_ints(RecTargets, &value, 1, 8);
+            targets[i].mask = value;
+            targets[i].name = trace_read(RecFile, NULL);
+        }
+        return;
+    }
+
+    if(trace_mode == TraceRecord){
+        value = ntargets;
+        trace_write_ints(RecTargets, &value, 1, 4);
+        for(int i=0; i < ntargets; ++i){
+            value = targets[i].mask;
+            trace_write_ints(RecTargets, &value, 1, 8);
+            trace_file(targets[i].name);
+        }
+    }
+}
+
+/* An X server went away, usually because its session ends. The other
+ * displays keep their bar: xioexit replaces the exit of Xlib.
+ */
+int xioerror(Display *dpy)
+{
+    fprintf(stderr, "dwmstatus: lost display '%s'.\n", DisplayString(dpy));
+    return 0;
+}
+
+void xioexit(Display *dpy, void *target)
+{
+    ((Target*)target)->lost = 1;
+}
+
+/* A screen is selected with the usual display name syntax (":0.1") */
+int open_target(Target *t)
+{
+    if (!(t->dpy = XOpenDisplay(t->name))) {
+        return 0;
+    }
+    XSetIOErrorExitHandler(t->dpy, xioexit, t);
+    t->root = RootWindow(t->dpy, DefaultScreen(t->dpy));
+    t->saver_event = -1;
+    t->saver_on = 0;
+    t->dirty = 1;
+
+    int event, error;
+    if(XScreenSaverQueryExtension(t->dpy, &event, &error)){
+        XScreenSaverInfo *info = XScreenSaverAllocInfo();
+        t->saver_event = event;
+        XScreenSaverSelectInput(t->dpy, t->root, ScreenSaverNotifyMask);
+        if(info != NULL){
+            XScreenSaverQueryInfo(t->dpy, t->root, info);
+            t->saver_on = info->state == ScreenSaverOn;
+            XFree(info);
+        }
+    }
+    t->dpms = DPMSQueryExtension(t->dpy, &event, &error) && DPMSCapable(t->dpy);
+    return 1;
+}
+
+/* Each target gets its own connection. A display that cannot be opened is
+ * tried again later. Return the number of opened displays.
+ */
+int open_targets(void)
+{
+    int opened = 0;
+
+    XSetIOErrorHandler(xioerror);
+    for(int i=0; i < ntargets; ++i){
+        Target *t = &targets[i];
+        t->visible = 1;
+        t->saver_event = -1;
+        if(trace_mode == TraceReplay){
+            ++opened;
+        }else if(open_target(t)){
+            ++opened;
+        }else{
+            fprintf(stderr, "dwmstatus: cannot open display '%s'.\n", XDisplayName(t->name));
+            t->visible = 0;
+            t->retry = time(NULL) + reconnect_interval;
+        }
+    }
+    return opened;
+}
+
+/* Close the connections that died and reopen the closed displays whose
+ * retry time came. Return the number of open displays.
+ */
+int check_targets(void)
+{
+    int opened = 0;
+    time_t now = time(NULL);
+
+    for(int i=0; i < ntargets; ++i){
+        Target *t = &targets[i];
+        if(t->lost){
+            XCloseDisplay(t->dpy);
+            t->dpy = NULL;
+            t->lost = 0;
+            t->visible = 0;
+            t->retry = now + reconnect_interval;
+            free(t->last);
+            t->last = NULL;
+        }
+        if(t->dpy == NULL && t->retry <= now){
+            if(open_target(t)){
+                fprintf(stderr, "dwmstatus: opened display '%s'.\n", XDisplayName(t->name));
+            }else{
+                t->retry = now + reconnect_interval;
+            }
+        }
+        opened += t->dpy != NULL;
+    }
+    return opened;
+}
+
+/* Mask of the targets whose screen is neither blanked by the screen saver
+ * nor powered down. The screen saver notifies its changes, DPMS has to be
+ * asked.
+ */
+uint32_t read_visibility(void)
+{
+    int64_t mask = 0;
+
+    if(trace_mode == TraceReplay){
+        trace_read_ints(RecVisible, &mask, 1, 4);
+        return mask;
+    }
+
+    for(int i=0; i < ntargets; ++i){
+        Target *t = &targets[i];
+        if(t->dpy == NULL || t->lost){
+            continue;
+        }
+        while(XPending(t->dpy)){
+            XEvent ev;
+            XNextEvent(t->dpy, &ev);
+            if(t->saver_event != -1 && ev.type == t->saver_event + ScreenSaverNotify){
+                t->saver_on = ((XScreenSaverNotifyEvent*)&ev)->state == ScreenSaverOn;
+            }
+        }
+        if(t->lost){
+            continue;
+        }
+
+        int dpms_off = 0;
+        if(t->dpms){
+            CARD16 level;
+            BOOL enabled;
+            dpms_off = DPMSInfo(t->dpy, &level, &enabled) && enabled && level != DPMSModeOn;
+        }
+        if(!t->saver_on && !dpms_off){
+            mask |= (uint32_t)1<<i;
+        }
+    }
+
+    if(trace_mode == TraceRecord){
+        trace_write_ints(RecVisible, &mask, 1, 4);
+    }
+    return mask;
+}
+
+/* Return the number of visible targets */
+int update_visibility(void)
+{
+    uint32_t mask = read_visibility();
+    int count = 0;
+
+    for(int i=0; i < ntargets; ++i){
+        int visible = (mask >> i) & 1;
+        if(visible && !targets[i].visible){
+            targets[i].dirty = 1;
+        }
+        targets[i].visible = visible;
+        count += visible;
+    }
+    return count;
+}
+
+void close_targets(void)
+{
+    for(int i=0; i < ntargets; ++i){
+        if(targets[i].dpy != NULL){
+            XCloseDisplay(targets[i].dpy);
+        }
+        free(targets[i].last);
+    }
+}
+
+int main(int argc, char *argv[])
+{
+    struct timespec start, painted;
+    int first_paint = 1;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    for(int i=1; i < argc; ++i){
+        if(i+1 < argc && config_file == NULL && !strcmp(argv[i], "-c")){
+            config_file = smprintf("%s", argv[++i]);
+        }else if(i+1 < argc && ntargets < MAX_TARGETS && !strcmp(argv[i], "-d")){
+            targets[ntargets].name = argv[++i];
+            targets[ntargets].mask = ~(uint64_t)0;
+            ++ntargets;
+        }else if(i+1 < argc && ntargets > 0 && !strcmp(argv[i], "-b")){
+            if(!(targets[ntargets-1].mask = parse_blocks(argv[++i]))){
+                usage();
+            }
+        }else if(i+1 < argc && trace_mode == TraceOff && !strcmp(argv[i], "-r")){
+            if(!trace_open(argv[++i], TraceRecord)){
+                return 1;
+            }
+        }else if(i+1 < argc && trace_mode == TraceOff && !strcmp(argv[i], "-p")){
+            if(!trace_open(argv[++i], TraceReplay)){
+                return 1;
+            }
+        }else{
+            usage();
+        }
+    }
+
+    /* Without -d, the status goes to $DISPLAY */
+    if(ntargets == 0){
+        targets[0].name = NULL;
+        targets[0].mask = ~(uint64_t)0;
+        ntargets = 1;
+    }
+    trace_targets();
+
+    if(!open_targets()){
+        fprintf(stderr, "dwmstatus: no display.\n");
+        close_targets();
+        return 1;
+    }
+
+    /* No SA_RESTART: the signal must cut the sleep short */
+    struct sigaction sa;
+    sigset_t stop;
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = terminate;
+    sigemptyset(&sa.sa_mask);
+    sigemptyset(&stop);
+    sigaddset(&stop, SIGINT);
+    sigaddset(&stop, SIGTERM);
+    sigaddset(&stop, SIGHUP);
+    sigaction(SIGINT, &sa, NULL);
+    sigaction(SIGTERM, &sa, NULL);
+    sigaction(SIGHUP, &sa, NULL);
+    /* A replay never sleeps */
+    if(trace_mode != TraceReplay){
+        sigprocmask(SIG_BLOCK, &stop, &sleep_mask);
+    }
+
+    char *status;
+    int paused = 0;
+    int cache_dirty = 0;
+
+    if(config_file == NULL){
+        config_file = config_path();
+    }
+    Config *c = read_config();
+    time_t now = get_now();
+    apply_config(c ? c : default_config(), now);
+    time_t cache_saved = now;
+
+    /* Paint the last known status right away, the blocks will replace
+     * their cached part as soon as they are queried.
+     * Sensors discovery is only done afterwards as walking /sys/class/hwmon
+     * is by far the slowest part of the startup.
+     * A replay does not touch the hardware nor the cache.
+     */
+    if(trace_mode != TraceReplay && load_cache(conf)){
+        for(int i=0; i < ntargets; ++i){
+            status = compose_status(targets[i].mask);
+            setstatus(&targets[i], status);
+            free(status);
+        }
+        clock_gettime(CLOCK_MONOTONIC, &painted);
+        first_paint = 0;
+        fprintf(stderr, "dwmstatus: cached status painted in %.2f ms\n",
+                (painted.tv_sec-start.tv_sec)*1e3 + (painted.tv_nsec-start.tv_nsec)/1e6);
+    }
+
+    if(trace_mode != TraceReplay){
+        detect_sensors(SensorAll);
+        if(config_file != NULL){
+            watch_config();
+        }
+    }
+
+    while(running){
+
+        /* Run tasks and update next_update if needed */
+        now = get_now();
+        uint64_t changed = 0;
+
+        /* The new table replaces the old one between two passes */
+        apply_watches(read_watches(), now);
+
+        /* The other displays keep their bar while one restarts, but there
+         * is nothing left to do once they are all gone.
+         */
+        if(trace_mode != TraceReplay && !check_targets()){
+            fprintf(stderr, "dwmstatus: no display left.\n");
+            break;
+        }
+
+        /* Nobody sees the bar: only the background blocks keep running.
+         * On wake up, every late block is queried in this single pass.
+         */
+        if(update_visibility()){
+            if(paused){
+                for(size_t i=0; i < conf->nentries; ++i){
+                    Entry *e = &conf->entries[i];
+                    if(!e->background && e->next_update <= now){
+                        e->flags |= 1<<0;
+                        while(e->next_update <= now){
+                            e->next_update += e->interval;
+                        }
+                    }
+                }
+                paused = 0;
+            }
+        }else{
+            paused = 1;
+        }
+
+        for(size_t i=0; i < conf->nentries; ++i){
+            Entry *e = &conf->entries[i];
+
+            if(!(used & (uint64_t)1<<i) || (paused && !e->background)){
+                continue;
+            }
+
+            if (e->next_update <= now || (e->flags & (1<<0) )){
+
+                /* Query informations and format them using status2d color codes */
+                e->query(&e->data);
+                format_block(e);
+
+                /* normal case */
+                if (e->next_update <= now){
+                    e->next_update += e->interval;
+                }
+                if(e->flags & (1<<0)){
+                    e->flags &= ~(1<<0);
+                }
+
+                changed |= (uint64_t)1<<i;
+            }
+
+        }
+
+        /* Update status */
+        for(int i=0; i < ntargets; ++i){
+            if(targets[i].visible && ((changed & targets[i].mask) || targets[i].dirty)){
+                status = compose_status(targets[i].mask);
+                setstatus(&targets[i], status);
+                free(status);
+                targets[i].dirty = 0;
+            }
+        }
+        /* Saved now and then as a session end rarely gives us time to */
+        cache_dirty |= changed != 0;
+        if(cache_dirty && now >= cache_saved + cache_interval && trace_mode != TraceReplay){
+            save_cache(conf);
+            cache_saved = now;
+            cache_dirty = 0;
+        }
+
+        if(changed && !paused && first_paint && trace_mode != TraceReplay){
+            clock_gettime(CLOCK_MONOTONIC, &painted);
+            first_paint = 0;
+            fprintf(stderr, "dwmstatus: first status painted in %.2f ms\n",
+                    (painted.tv_sec-start.tv_sec)*1e3 + (painted.tv_nsec-start.tv_nsec)/1e6);
+        }
+
+        /* Determine how long we can sleep */
+        time_t min_next = -1;
+        for(size_t i=0; i < conf->nentries; ++i){
+            Entry *e = &conf->entries[i];
+            if ((used & (uint64_t)1<<i) && (!paused || e->background)
+                && (min_next == -1 || e->next_update < min_next)){
+                min_next = e->next_update;
+            }
+        }
+        /* Screen saver changes wake us up, DPMS ones do not */
+        if(paused){
+            for(int i=0; i < ntargets; ++i){
+                if(targets[i].dpy != NULL && targets[i].dpms && (min_next == -1 || now + dpms_poll < min_next)){
+                    min_next = now + dpms_poll;
+                }
+            }
+        }
+        for(int i=0; i < ntargets; ++i){
+            if(trace_mode != TraceReplay && targets[i].dpy == NULL && (min_next == -1 || targets[i].retry < min_next)){
+                min_next = targets[i].retry;
+            }
+        }
+
+        /* The virtual clock jumps straight to the next update */
+        if(trace_mode != TraceReplay){
+            sleep_until(min_next);
+        }
+    }
+
+    if(trace_mode != TraceReplay){
+        save_cache(conf);
+    }
+    free_config(conf);
+    free(config_file);
+    free(config_dir);
+    free(watched_dir);
+    if(watch_fd != -1){
+        close(watch_fd);
+    }
+
+    trace_close();
+    close_targets();
+
+    free_sensors(SensorAll);
+
+    return 0;
+}
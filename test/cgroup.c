@@ -0,0 +1,99 @@
+/* Runs the cgroup block against a fake cgroupfs */
+#define main dwmstatus_main
+#include "../dwmstatus.c"
+#undef main
+
+static char root[] = "/tmp/dwmstatus-cgroup-XXXXXX";
+static const char *files[] = {
+    "memory.current", "memory.max", "memory.swap.current", "cpu.stat", "memory.events",
+};
+static int failures;
+
+void write_file(char *name, char *content)
+{
+    char *path = smprintf("%s/user.slice/%s", root, name);
+    FILE *fd = fopen(path, "w");
+    if(fd == NULL){
+        perror(path);
+        exit(1);
+    }
+    fputs(content, fd);
+    fclose(fd);
+    free(path);
+}
+
+void check(int cond, char *what, BlockData *data)
+{
+    if(!cond){
+        fprintf(stderr, "cgroup: %s (text '%s', color '%s')\n", what, data->text, data->color);
+        ++failures;
+    }
+}
+
+int main(void)
+{
+    BlockData data;
+
+    if(mkdtemp(root) == NULL){
+        perror("mkdtemp");
+        return 1;
+    }
+    char *dir = smprintf("%s/user.slice", root);
+    mkdir(dir, 0700);
+
+    write_file("memory.current", "1073741824\n");
+    write_file("memory.max", "2147483648\n");
+    write_file("memory.swap.current", "0\n");
+    write_file("cpu.stat", "usage_usec 1000\nuser_usec 600\nsystem_usec 400\n");
+    write_file("memory.events", "low 0\nhigh 0\nmax 0\noom 0\noom_kill 0\n");
+
+    char *text = smprintf("cgroup_root %s\ncgroup user.slice\nblock cgroup 60 0 0\n", root);
+    apply_config(parse_config(text, "test"), 0);
+    free(text);
+    open_cgroup();
+
+    /* First call: no CPU usage yet */
+    get_cgroup(&data);
+    check(!strcmp(data.text, "1024M/2.0G"), "usage against the limit", &data);
+    check(!strcmp(data.color, "#b48ead"), "color below the limit", &data);
+
+    /* 50ms of CPU in at least 100ms */
+    write_file("memory.current", "2000000000\n");
+    write_file("memory.swap.current", "104857600\n");
+    write_file("cpu.stat", "usage_usec 51000\nuser_usec 30600\nsystem_usec 20400\n");
+    usleep(100000);
+    get_cgroup(&data);
+    check(!strncmp(data.text, "1.9G/2.0G S: 100M ", strlen("1.9G/2.0G S: 100M ")), "usage with swap", &data);
+    char *cpu = strrchr(data.text, ' ');
+    int percent = cpu ? atoi(cpu+1) : -1;
+    check(cpu && cpu[strlen(cpu)-1] == '%' && percent > 0 && percent <= 50, "CPU delta", &data);
+    check(!strcmp(data.color, "#bf616a"), "color near the limit", &data);
+
+    /* No limit */
+    write_file("memory.max", "max\n");
+    get_cgroup(&data);
+    check(!strncmp(data.text, "1.9G S: 100M", strlen("1.9G S: 100M")), "usage without limit", &data);
+
+    /* A memory event queries the block early */
+    write_file("memory.events", "low 0\nhigh 1\nmax 0\noom 0\noom_kill 0\n");
+    int watches = read_watches();
+    check(watches & WatchCgroup, "memory.events watch", &data);
+    apply_watches(watches, 0);
+    check(conf->entries[0].flags & (1<<0), "early refresh", &data);
+
+    close_cgroup();
+    free_config(conf);
+    for(size_t i=0; i < LENGTH(files); ++i){
+        char *path = smprintf("%s/%s", dir, files[i]);
+        unlink(path);
+        free(path);
+    }
+    rmdir(dir);
+    rmdir(root);
+    free(dir);
+
+    if(failures == 0){
+        printf("cgroup: ok\n");
+    }
+    return failures != 0;
+}
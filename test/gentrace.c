@@ -0,0 +1,167 @@
+/* Writes the trace replayed by `make test`: the default blocks for 400
+ * seconds with a configuration reload, a full battery, a stopped fan, a
+ * muted then failing volume and the displays off for a while. Recording
+ * needs a live X server, so the records are written in the order the main
+ * loop reads them.
+ */
+#define main dwmstatus_main
+#include "../dwmstatus.c"
+#undef main
+
+#define T0 1700000010
+
+static const char reload[] =
+    "bar_color #3b4252\n"
+    "block volume 1 0 10\n"
+    "block ram 60 0 0\n"
+    "block fan 20 0 0\n"
+    "block battery 120 0 0\n"
+    "block power 20 0 0 background\n"
+    "block temperature 20 0 0\n"
+    "block time 60 1592384460 -1\n";
+
+void rec_time(time_t now)
+{
+    int64_t t = now;
+    trace_write_ints(RecTime, &t, 1, 8);
+}
+
+void rec_int(int type, int64_t value)
+{
+    trace_write_ints(type, &value, 1, 4);
+}
+
+void rec_file(char *fmt, long value)
+{
+    char *content = smprintf(fmt, value);
+    trace_file(content);
+    free(content);
+}
+
+/* Result, total and free RAM, total and free swap, memory unit */
+void rec_sysinfo(time_t now)
+{
+    long k = now - T0;
+    int64_t used = 3000000000LL + (now % 97) * 10000000LL;
+    int64_t swap = k < 300 ? 0 : 200 * 1048576LL;
+    int64_t fields[] = { 0, 16000000000LL, 16000000000LL - used, 4000000000LL, 4000000000LL - swap, 1 };
+
+    trace_write_ints(RecSysinfo, fields, LENGTH(fields), 8);
+}
+
+/* What the query of the block reads at `now` */
+void rec_block(void (*query)(BlockData*), time_t now)
+{
+    long k = now - T0;
+
+    if(query == get_volume){
+        rec_int(RecVolume, k < 60 ? 80 : k < 120 ? 0 : k == 120 ? -1 : 30);
+    }else if(query == get_ram){
+        rec_sysinfo(now);
+    }else if(query == get_fan_speed){
+        int stopped = k >= 100 && k < 180;
+        rec_file("%ld\n", stopped ? 0 : 2400 + k);
+        rec_file("%ld\n", stopped ? 0 : 2600 + k);
+    }else if(query == get_battery){
+        rec_file("%ld\n", 1);
+        rec_file("%ld\n", 87 - k/60);
+    }else if(query == get_power){
+        if(k >= 240 && k < 260){
+            rec_file("Full\n", 0);
+            return;
+        }
+        rec_file("Discharging\n", 0);
+        rec_file("%ld\n", 800000 + 37000 * (k/20));
+        rec_file("%ld\n", 12100000);
+    }else if(query == get_temperature){
+        rec_file("%ld\n", 38000 + 1000 * (k/20));
+    }else if(query == get_time){
+        rec_time(now);
+    }
+}
+
+int main(int argc, char *argv[])
+{
+    if(argc != 2){
+        fprintf(stderr, "usage: gentrace trace\n");
+        return 1;
+    }
+    if(!trace_open(argv[1], TraceRecord)){
+        return 1;
+    }
+
+    /* $DISPLAY shows every block */
+    targets[0].mask = ~(uint64_t)0;
+    ntargets = 1;
+    trace_targets();
+
+    /* No configuration file: the compiled blocks are used */
+    conf = default_config();
+    trace_file(NULL);
+    time_t now = T0;
+    rec_time(now);
+    for(size_t i=0; i < conf->nentries; ++i){
+        schedule(&conf->entries[i], now);
+    }
+
+    int paused = 0;
+    int reloaded = 0;
+    while(now < T0 + 400){
+        rec_time(now);
+
+        /* Only the bar color changes, the blocks keep their schedule */
+        if(!reloaded && now >= T0 + 150){
+            rec_int(RecWatch, WatchConfig);
+            trace_write(RecFile, reload, strlen(reload));
+            reloaded = 1;
+        }else{
+            rec_int(RecWatch, 0);
+        }
+
+        int visible = now - T0 < 200 || now - T0 >= 290;
+        rec_int(RecVisible, visible);
+        if(visible){
+            if(paused){
+                for(size_t i=0; i < conf->nentries; ++i){
+                    Entry *e = &conf->entries[i];
+                    if(!e->background && e->next_update <= now){
+                        e->flags |= 1<<0;
+                        while(e->next_update <= now){
+                            e->next_update += e->interval;
+                        }
+                    }
+                }
+                paused = 0;
+            }
+        }else{
+            paused = 1;
+        }
+
+        for(size_t i=0; i < conf->nentries; ++i){
+            Entry *e = &conf->entries[i];
+            if(paused && !e->background){
+                continue;
+            }
+            if(e->next_update <= now || (e->flags & (1<<0))){
+                rec_block(e->query, now);
+                if(e->next_update <= now){
+                    e->next_update += e->interval;
+                }
+                e->flags &= ~(1<<0);
+            }
+        }
+
+        time_t min_next = -1;
+        for(size_t i=0; i < conf->nentries; ++i){
+            Entry *e = &conf->entries[i];
+            if((!paused || e->background) && (min_next == -1 || e->next_update < min_next)){
+                min_next = e->next_update;
+            }
+        }
+        now = min_next;
+    }
+
+    trace_close();
+    free_config(conf);
+    return 0;
+}
@@ -0,0 +1,205 @@
+/* Records every traced read against fake files, then replays the trace
+ * and checks that the same values come back
+ */
+#define main dwmstatus_main
+#include "../dwmstatus.c"
+#undef main
+
+static char dir[] = "/tmp/dwmstatus-trace-XXXXXX";
+static int failures;
+
+typedef struct {
+    char *config_text;
+    char *file;
+    char *missing;
+    char *fd_file;
+    char *bad_fd;
+    int sysinfo_ret;
+    unsigned long totalram, freeram, totalswap, freeswap;
+    unsigned int mem_unit;
+    int volume;
+    time_t now;
+    int64_t usec;
+    int watches[3];
+    uint32_t visible;
+    int ntargets;
+    uint64_t masks[2];
+    char *names[2];
+} Reads;
+
+void write_file(char *name, char *content)
+{
+    char *path = smprintf("%s/%s", dir, name);
+    FILE *fd = fopen(path, "w");
+    if(fd == NULL){
+        perror(path);
+        exit(1);
+    }
+    fputs(content, fd);
+    fclose(fd);
+    free(path);
+}
+
+void check(int cond, char *what)
+{
+    if(!cond){
+        fprintf(stderr, "trace: %s\n", what);
+        ++failures;
+    }
+}
+
+int same_string(char *a, char *b)
+{
+    return (a == NULL && b == NULL) || (a != NULL && b != NULL && !strcmp(a, b));
+}
+
+/* The same sequence runs while recording and while replaying */
+void run(Reads *r)
+{
+    struct sysinfo s;
+    char *path;
+
+    trace_targets();
+    r->ntargets = ntargets;
+    for(int i=0; i < 2 && i < ntargets; ++i){
+        r->masks[i] = targets[i].mask;
+        r->names[i] = targets[i].name;
+    }
+
+    Config *c = read_config();
+    r->config_text = c ? smprintf("%s %zu", c->bar_color, c->nentries) : NULL;
+    free_config(c);
+
+    path = smprintf("%s/file", dir);
+    r->file = read_file(path);
+    free(path);
+    path = smprintf("%s/missing", dir);
+    r->missing = read_file(path);
+    free(path);
+
+    path = smprintf("%s/file", dir);
+    int fd = trace_mode == TraceRecord ? open(path, O_RDONLY) : -1;
+    r->fd_file = read_fd(fd);
+    r->bad_fd = read_fd(-1);
+    if(fd != -1){
+        close(fd);
+    }
+    free(path);
+
+    memset(&s, 0, sizeof(s));
+    r->sysinfo_ret = read_sysinfo(&s);
+    r->totalram = s.totalram;
+    r->freeram = s.freeram;
+    r->totalswap = s.totalswap;
+    r->freeswap = s.freeswap;
+    r->mem_unit = s.mem_unit;
+
+    r->volume = read_volume();
+    r->now = get_now();
+    r->usec = get_usec();
+
+    /* Nothing, then a new configuration moved in place, then nothing */
+    r->watches[0] = read_watches();
+    if(trace_mode == TraceRecord){
+        write_file("config.tmp", "bar_color #000000\nblock time 60 0 0\n");
+        char *from = smprintf("%s/config.tmp", dir);
+        rename(from, config_file);
+        free(from);
+    }
+    r->watches[1] = read_watches();
+    r->watches[2] = read_watches();
+
+    r->visible = read_visibility();
+}
+
+void free_reads(Reads *r)
+{
+    free(r->config_text);
+    free(r->file);
+    free(r->missing);
+    free(r->fd_file);
+    free(r->bad_fd);
+}
+
+int main(void)
+{
+    Reads rec, play;
+
+    if(mkdtemp(dir) == NULL){
+        perror("mkdtemp");
+        return 1;
+    }
+    char *trace = smprintf("%s/trace", dir);
+    config_file = smprintf("%s/config", dir);
+    write_file("config", "bar_color #3b4252\nblock ram 60 0 0\nblock time 60 0 0\n");
+    write_file("file", "42\n");
+
+    /* Two displays that are never opened */
+    targets[0].name = ":5";
+    targets[0].mask = 1<<0 | 1<<6;
+    targets[1].name = NULL;
+    targets[1].mask = ~(uint64_t)0;
+    ntargets = 2;
+
+    if(!trace_open(trace, TraceRecord)){
+        return 1;
+    }
+    watch_config();
+    run(&rec);
+    trace_close();
+    close(watch_fd);
+    watch_fd = -1;
+
+    check(same_string(rec.config_text, "#3b4252 2"), "configuration read");
+    check(same_string(rec.file, "42\n") && rec.missing == NULL, "file read");
+    check(same_string(rec.fd_file, "42\n") && rec.bad_fd == NULL, "fd read");
+    check(rec.sysinfo_ret == 0 && rec.totalram != 0, "sysinfo");
+    check(rec.watches[0] == 0 && rec.watches[1] == WatchConfig && rec.watches[2] == 0, "watches");
+
+    /* Replayed without -d */
+    memset(targets, 0, sizeof(targets));
+    ntargets = 1;
+    trace_mode = TraceOff;
+    if(!trace_open(trace, TraceReplay)){
+        return 1;
+    }
+    run(&play);
+
+    check(same_string(play.config_text, rec.config_text), "replayed configuration");
+    check(same_string(play.file, rec.file) && play.missing == NULL, "replayed file");
+    check(same_string(play.fd_file, rec.fd_file) && play.bad_fd == NULL, "replayed fd");
+    check(play.sysinfo_ret == rec.sysinfo_ret && play.totalram == rec.totalram && play.freeram == rec.freeram
+        && play.totalswap == rec.totalswap && play.freeswap == rec.freeswap && play.mem_unit == rec.mem_unit,
+        "replayed sysinfo");
+    check(play.volume == rec.volume, "replayed volume");
+    check(play.now == rec.now && play.usec == rec.usec, "replayed clocks");
+    check(!memcmp(play.watches, rec.watches, sizeof(rec.watches)), "replayed watches");
+    check(play.visible == rec.visible, "replayed visibility");
+    check(play.ntargets == 2 && play.masks[0] == rec.masks[0] && play.masks[1] == rec.masks[1]
+        && same_string(play.names[0], ":5") && play.names[1] == NULL, "replayed displays");
+
+    /* The replay ends with the trace */
+    uint8_t t;
+    check(fread(&t, 1, 1, trace_fd) == 0 && feof(trace_fd), "trace fully replayed");
+    trace_close();
+
+    free_reads(&rec);
+    free_reads(&play);
+    free(play.names[0]);
+    char *files[] = { "config", "file", "trace" };
+    for(size_t i=0; i < LENGTH(files); ++i){
+        char *path = smprintf("%s/%s", dir, files[i]);
+        unlink(path);
+        free(path);
+    }
+    rmdir(dir);
+    free(trace);
+    free(config_file);
+    free(config_dir);
+    free(watched_dir);
+
+    if(failures == 0){
+        printf("trace: ok\n");
+    }
+    return failures != 0;
+}